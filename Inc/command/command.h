@@ -3,6 +3,11 @@
 
 #define COMMAND_CONFIG_ERROR_VAR_LENGTH_MUST_HAVE_SUFFIX 1;
 #define COMMAND_CONFIG_ERROR_FIXED_LENGTH_MUST_HAVE_PREFIX 2;
+#define COMMAND_CONFIG_ERROR_QUEUE_CAPACITY_MUST_BE_POWER_OF_2 3;
+#define COMMAND_CONFIG_ERROR_FILTER_FIELD_SIZE_OUT_OF_RANGE 4;
+#define COMMAND_CONFIG_ERROR_TLV_FIELD_SIZE_OUT_OF_RANGE 5;
+
+#define COMMAND_FILTER_FIELD_MAX_SIZE 8U
 
 #define Command_PARSE_STAGE_INIT 0U
 #define Command_PARSE_STAGE_SEEKING_PREFIX 10U
@@ -26,13 +31,20 @@ typedef struct Command_Config
     char *suffixChars;
 } Command_Config;
 
+typedef struct Command_Trigger
+{
+    uint8_t waitExpectLength : 1; // Trigger once the length that parser waits for has been appended.
+    uint32_t thresholdLength;     // Trigger once so many bytes have been appended since last parse. 0=disabled.
+    uint32_t idleTimeout;         // Trigger by Command_Poll once nothing has been appended for so many ticks. 0=disabled.
+} Command_Trigger;
+
 typedef struct Command_Buffer
 {
     struct Command_Buffer *nextBuffer;
     char *data;
     uint32_t size;
-    uint8_t completed : 1;
-    uint8_t refCount : 7;
+    uint32_t refCount; // Count of pending frames which start in this buffer. Later buffers are kept alive by the start one.
+    uint8_t completed; // Set by parser once it has moved past this buffer.
 } Command_Buffer;
 
 typedef struct Command_Frame
@@ -46,6 +58,22 @@ typedef struct Command_Frame
 
 } Command_Frame;
 
+typedef struct Command_FrameSlot
+{
+    uint32_t sequence; // Slot turn. Equals to enqueue position when empty, position + 1 when filled.
+    Command_Frame *frame;
+} Command_FrameSlot;
+
+struct Command_Controller;
+
+typedef struct Command_Filter
+{
+    struct Command_Filter *nextFilter;
+    uint32_t offset; // Field position from the frame start, same as startPos of Command_ExtractFrame.
+    uint8_t size;    // Field size, 1-COMMAND_FILTER_FIELD_MAX_SIZE.
+    int8_t (*Predicate)(struct Command_Controller *controller, char *field, uint8_t size); // return 0=accept, otherwise reject.
+} Command_Filter;
+
 typedef struct Command_Workspace
 {
 
@@ -53,6 +81,7 @@ typedef struct Command_Workspace
     int32_t startOffset;           // Pointer to the previous position of the frame's buffer start position.
     uint32_t expectContentLength;  // The value represents content length that been parsed, if block has fixed length.
     uint32_t currentContentLength; // Frame content length that has been parsed.
+    uint32_t expectAvailableLength; // Length that should be appended before parser can go ahead.
 
     Command_Buffer *lastBuffer; // next read buffer. set by buffer append, read and move forward by parse stage.
     int32_t lastOffset;        // next read postion.
@@ -60,35 +89,111 @@ typedef struct Command_Workspace
     Command_Buffer *segmentStartBuffer; //
     int32_t segmentStartOffset;        //
 
+    Command_Buffer *matchedHeadBuffer; // Previous position of the partially matched pattern head, kept between chars scans. 0=not scanning.
+    int32_t matchedHeadOffset;         //
+    int8_t matchedLength;              // Partially matched length of pattern, -1=not scanning. Scan resumes from lastOffset with it.
+
+    Command_Filter *pendingFilter; // Next filter to be evaluated for current frame.
+    uint8_t rejected;              // Current frame has been rejected by filter, it will be skipped instead of packed.
+
     uint8_t stage;
 
     Command_Config config;
 
 } Command_Workspace;
 
+typedef struct Command_TlvConfig
+{
+    uint8_t tagFieldSize : 3;    // tag size in bytes, 1-4.
+    uint8_t lengthFieldSize : 3; // length size in bytes, 1-4. Length represents the value length only.
+    uint8_t littleEndian : 1;    // 0=big endian, 1=little endian.
+} Command_TlvConfig;
+
+typedef struct Command_TlvEntry
+{
+    uint32_t tag;
+    uint32_t valuePos;    // Value position from the frame start, same as startPos of Command_ExtractFrame.
+    uint32_t valueLength;
+} Command_TlvEntry;
+
+typedef struct Command_TlvIndex
+{
+    struct Command_Controller *controller; // Used to allocate the index tables.
+    Command_Frame *frame;
+    Command_TlvConfig config;
+    uint32_t startPos; // Position of the first record from the frame start.
+    uint32_t length;   // Total length of the records.
+
+    Command_TlvEntry *entries; // Records in order, built on first access.
+    uint32_t entryCount;
+    uint32_t *slots; // Open addressing table, map tag to entry index + 1, 0=empty.
+    uint32_t slotMask;
+    uint8_t built : 1;
+    uint8_t malformed : 1; // Records do not fit the length, entries before the broken one are still indexed.
+} Command_TlvIndex;
+
 typedef struct Command_Controller
 {
     Command_Config config;
     Command_Frame *pendingFramesHead;
     Command_Frame *pendingFramesTail;
+    Command_FrameSlot *frameSlots; // Bounded MPMC queue of pending frames, replace the pending list if set. See Command_InitFrameQueue.
+    uint32_t frameSlotMask;
+    uint32_t frameEnqueuePos;
+    uint32_t frameDequeuePos;
+    uint32_t reclaimRequests; // Pending reclaim requests. Only the thread which raises it from 0 reclaims buffers.
     void *outerState;
     Command_Buffer *bufferHead;
     Command_Buffer *bufferTail;
+    Command_Buffer *parsedBuffer; // Low watermark of parser. Buffers before it are completed, reclaimed once their refCount drops to 0.
     Command_Workspace workspace;
     int8_t *prefixNexts;
     int8_t *suffixNexts;
+    Command_Filter *filters; // Sorted by field end position, so that they can be evaluated in order while scanning.
     int8_t (*BufferAppendCallback)(struct Command_Controller *controller);
+    Command_Trigger trigger;
+    uint32_t appendedLength; // Length appended since last parse.
+    uint32_t lastAppendTick;
+    uint8_t parseTriggered;  // Set once callback has been triggered, cleared by parse. Callback is not triggered again in between.
 } Command_Controller;
 
 int8_t Command_Init(Command_Controller *controller, Command_Config cfg, char *name, int8_t (*bufferAppendCallback)(struct Command_Controller *controller), void *outerState);
 
 void *Command_Malloc(Command_Controller *controller, uint32_t size);
 void Command_Mrelease(Command_Controller *controller, void *ptr);
+uint32_t Command_GetTick(Command_Controller *controller);
+
+/**
+ * Set the policy deciding when BufferAppendCallback is triggered. Callback is triggered on every append if no policy is set.
+ * */
+void Command_SetTrigger(Command_Controller *controller, Command_Trigger trigger);
+
+/**
+ * Trigger BufferAppendCallback if idle timeout has elapsed with unparsed data, or if parser waits for a free slot of frame queue which is available now.
+ * Should be called periodically if idleTimeout is set.
+ * */
+void Command_Poll(Command_Controller *controller);
 
 void Command_AppendBuffer(Command_Controller *controller, char *data, uint32_t size);
 
 int8_t Command_Parse(Command_Controller *controller, Command_Config *customConfig);
 
+/**
+ * Switch pending frames to a bounded lock-free queue, so that several threads can pick and release frames
+ * concurrently while parser keeps producing. Should be called after Command_Init and before first parse.
+ * @arg capacity: max count of pending frames, must be power of 2 and at least 2, a single slot can not tell filled from empty. Parse stops at the done stage when queue is full.
+ * Once a slot is freed, BufferAppendCallback is triggered from the picking thread, so it should not parse in place if frames are picked by other threads.
+ * @return 0=success, COMMAND_CONFIG_ERROR_QUEUE_CAPACITY_MUST_BE_POWER_OF_2.
+ * */
+int8_t Command_InitFrameQueue(Command_Controller *controller, uint32_t capacity);
+
+/**
+ * Register a filter evaluated as soon as its field has been scanned. Frames rejected by any filter are dropped before packing.
+ * Filter is owned by caller and should keep alive while registered.
+ * @return 0=success, COMMAND_CONFIG_ERROR_FILTER_FIELD_SIZE_OUT_OF_RANGE.
+ * */
+int8_t Command_AddFilter(Command_Controller *controller, Command_Filter *filter);
+
 Command_Frame *Command_PickFrame(Command_Controller *controller);
 
 void Command_ReleaseFrame(Command_Controller *controller, Command_Frame *frame);
@@ -97,4 +202,33 @@ int8_t Command_ClearFrame(Command_Controller *controller);
 
 uint32_t Command_ExtractFrame(Command_Frame *frame, uint32_t startPos, uint32_t length, char *dist);
 
+/**
+ * Init a lazy TLV index over the records in frame, nothing is read until first access.
+ * @arg startPos: position of the first record from the frame start.
+ * @arg length: total length of the records. Clamped to the end of the frame, and malformed is set if so.
+ * @return 0=success, COMMAND_CONFIG_ERROR_TLV_FIELD_SIZE_OUT_OF_RANGE.
+ * */
+int8_t Command_TlvInit(Command_Controller *controller, Command_TlvIndex *index, Command_Frame *frame, uint32_t startPos, uint32_t length, Command_TlvConfig config);
+
+/**
+ * Init a lazy TLV index over the value of entry, with the same config as parent.
+ * */
+int8_t Command_TlvInitNested(Command_TlvIndex *index, Command_TlvIndex *parent, Command_TlvEntry *entry);
+
+uint32_t Command_TlvGetCount(Command_TlvIndex *index);
+
+/**
+ * @return entry at i in record order, 0 if out of range.
+ * */
+Command_TlvEntry *Command_TlvGetEntry(Command_TlvIndex *index, uint32_t i);
+
+/**
+ * @return the first entry with tag, 0 if not found.
+ * */
+Command_TlvEntry *Command_TlvFind(Command_TlvIndex *index, uint32_t tag);
+
+uint32_t Command_TlvExtractValue(Command_TlvIndex *index, Command_TlvEntry *entry, char *dist);
+
+void Command_TlvRelease(Command_TlvIndex *index);
+
 // #endif //__WINDWOLF_COMMAND_H_
@@ -10,6 +10,7 @@ static int8_t Command_ClearBuffer(Command_Controller *controller);
 
 static int8_t Command_CheckConfig(Command_Config config);
 /**
+ * Resume from the matched state in workspace if the last scan ran out of data, so each char is examined once.
  * @arg
  * @arg pattern: search pattern.
  * @return 0=success, 1=not enough data.
@@ -25,7 +26,7 @@ static int8_t Command_ScanUint(Command_Controller *controller, uint8_t size, uin
 
 /**
  * @arg
- * @arg length: content expect length.
+ * @arg length: remaining content length, scanning continues from lastOffset.
  * @return 0=success, 1=not enough data.
  * */
 static int8_t Command_ScanContent(Command_Controller *controller, uint32_t length, uint32_t *scanedLength);
@@ -41,7 +42,66 @@ static int8_t Command_MatchChars(Command_Controller *controller, char *pattern,
 
 static void Command_ComputeNext(char *p, uint8_t M, int8_t *next);
 
-static int8_t Command_HasAvailableLength(Command_Buffer *buffer, int32_t offset, uint32_t length);
+/**
+ * @return 0=available, otherwise the length still missing.
+ * */
+static uint32_t Command_GetMissingLength(Command_Buffer *buffer, int32_t offset, uint32_t length);
+
+/**
+ * @return 1=callback should be triggered.
+ * */
+static int8_t Command_IsTriggered(Command_Controller *controller);
+
+static void Command_RaiseTrigger(Command_Controller *controller);
+
+/**
+ * Evaluate pending filters of which the field is in the scanned length, stop at the first rejection.
+ * @arg scannedLength: length scanned from the frame start.
+ * */
+static void Command_ApplyFilters(Command_Controller *controller, uint32_t scannedLength);
+
+/**
+ * @return length from the position after (fromBuffer, fromOffset) to (toBuffer, toOffset).
+ * */
+static uint32_t Command_GetDistance(Command_Buffer *fromBuffer, int32_t fromOffset, Command_Buffer *toBuffer, int32_t toOffset);
+
+/**
+ * Copy data start at pos from the position after (buffer, offset).
+ * */
+static void Command_CopyData(Command_Buffer *buffer, int32_t offset, uint32_t pos, uint32_t length, char *dist);
+
+/**
+ * Move parsedBuffer forward to the earliest buffer still referenced by workspace, mark the passed buffers completed.
+ * */
+static void Command_AdvanceParsedBuffer(Command_Controller *controller);
+
+/**
+ * Release buffers from bufferHead, until reach a buffer which is not completed or still referenced by a frame.
+ * */
+static void Command_ReclaimBuffers(Command_Controller *controller);
+
+/**
+ * @return 0=success, 1=queue is full.
+ * */
+static int8_t Command_EnqueueFrame(Command_Controller *controller, Command_Frame *frame);
+
+/**
+ * Raise the parse trigger if parser is parked at the done stage, since a slot has been freed.
+ * */
+static Command_Frame *Command_DequeueFrame(Command_Controller *controller);
+
+/**
+ * @return 1=the next enqueue will find a free slot.
+ * */
+static int8_t Command_HasFreeSlot(Command_Controller *controller);
+
+/**
+ * Read next buffer with acquire, it is published by Command_AppendBuffer which may run concurrently with parse.
+ * */
+static inline Command_Buffer *Command_NextBuffer(Command_Buffer *buffer)
+{
+    return __atomic_load_n(&buffer->nextBuffer, __ATOMIC_ACQUIRE);
+}
 
 static int8_t Command_ClearBuffer(Command_Controller *controller)
 {
@@ -75,28 +135,31 @@ static int8_t Command_PackFrame(Command_Controller *controller)
     Command_Buffer *lastBuffer = controller->workspace.lastBuffer;
     int32_t lastOffset = controller->workspace.startOffset;
 
+    if (controller->frameSlots != 0 && !Command_HasFreeSlot(controller))
+    {
+        return 1; // Parser is the only producer, so a free slot can not be taken by others once checked.
+    }
+
     Command_Frame *frame = (Command_Frame *)Command_Malloc(controller, sizeof(Command_Frame));
     frame->length = controller->workspace.currentContentLength + Command_CalculateOverHeadLength(controller->workspace.config);
     frame->startBuffer = startBuffer;
     frame->startOffset = startOffset;
     frame->lastBuffer = lastBuffer;
     frame->lastOffset = lastOffset;
+    frame->nextFrame = 0;
+
+    __atomic_add_fetch(&startBuffer->refCount, 1, __ATOMIC_RELAXED); // Only start buffer is referenced, buffers are reclaimed in list order, so the following ones are kept alive by it.
 
-    while (startBuffer != 0)
+    if (controller->frameSlots != 0)
     {
-        (startBuffer->refCount)++; // Add reference count.
-        if (startBuffer != lastBuffer)
+        if (Command_EnqueueFrame(controller, frame) != 0)
         {
-            startBuffer->completed = 1; // Set to true, if all of the buffer content has been packed. Other words, set to true except last buffer.
-            startBuffer = startBuffer->nextBuffer;
-        }
-        else
-        {
-            break;
+            __atomic_sub_fetch(&startBuffer->refCount, 1, __ATOMIC_RELAXED);
+            Command_Mrelease(controller, frame);
+            return 1;
         }
     }
-
-    if (controller->pendingFramesTail == 0)
+    else if (controller->pendingFramesTail == 0)
     {
         controller->pendingFramesTail = frame;
         controller->pendingFramesHead = frame;
@@ -110,6 +173,187 @@ static int8_t Command_PackFrame(Command_Controller *controller)
     return 0;
 }
 
+static void Command_AdvanceParsedBuffer(Command_Controller *controller)
+{
+    Command_Buffer *buffer = controller->parsedBuffer;
+    while (buffer != controller->workspace.lastBuffer && buffer != controller->workspace.segmentStartBuffer && buffer != controller->workspace.startBuffer && buffer != controller->workspace.matchedHeadBuffer)
+    {
+        Command_Buffer *nextBuffer = Command_NextBuffer(buffer);
+        __atomic_store_n(&buffer->completed, 1, __ATOMIC_RELEASE); // buffer may be released by other thread since now.
+        buffer = nextBuffer;
+    }
+    controller->parsedBuffer = buffer;
+}
+
+static void Command_ReclaimBuffers(Command_Controller *controller)
+{
+    if (__atomic_fetch_add(&controller->reclaimRequests, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+        return; // Other thread is reclaiming, it will take another round for this request.
+    }
+
+    uint32_t requests;
+    do
+    {
+        requests = __atomic_load_n(&controller->reclaimRequests, __ATOMIC_ACQUIRE);
+
+        Command_Buffer *buffer = controller->bufferHead;
+        while (__atomic_load_n(&buffer->completed, __ATOMIC_ACQUIRE) && __atomic_load_n(&buffer->refCount, __ATOMIC_ACQUIRE) == 0) // completed buffer always has next buffer.
+        {
+            Command_Buffer *nextBuffer = Command_NextBuffer(buffer);
+            Command_Mrelease(controller, buffer->data);
+            Command_Mrelease(controller, buffer);
+            buffer = nextBuffer;
+        }
+        controller->bufferHead = buffer;
+    } while (__atomic_sub_fetch(&controller->reclaimRequests, requests, __ATOMIC_ACQ_REL) != 0);
+}
+
+static int8_t Command_EnqueueFrame(Command_Controller *controller, Command_Frame *frame)
+{
+    uint32_t pos = __atomic_load_n(&controller->frameEnqueuePos, __ATOMIC_RELAXED);
+    while (1)
+    {
+        Command_FrameSlot *slot = &controller->frameSlots[pos & controller->frameSlotMask];
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&controller->frameEnqueuePos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                slot->frame = frame;
+                __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+            // pos has been reloaded by compare exchange.
+        }
+        else if (diff < 0)
+        {
+            return 1; // full
+        }
+        else
+        {
+            pos = __atomic_load_n(&controller->frameEnqueuePos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static int8_t Command_HasFreeSlot(Command_Controller *controller)
+{
+    uint32_t pos = __atomic_load_n(&controller->frameEnqueuePos, __ATOMIC_RELAXED);
+    return __atomic_load_n(&controller->frameSlots[pos & controller->frameSlotMask].sequence, __ATOMIC_SEQ_CST) == pos;
+}
+
+static Command_Frame *Command_DequeueFrame(Command_Controller *controller)
+{
+    uint32_t pos = __atomic_load_n(&controller->frameDequeuePos, __ATOMIC_RELAXED);
+    while (1)
+    {
+        Command_FrameSlot *slot = &controller->frameSlots[pos & controller->frameSlotMask];
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&controller->frameDequeuePos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                Command_Frame *frame = slot->frame;
+                __atomic_store_n(&slot->sequence, pos + controller->frameSlotMask + 1, __ATOMIC_SEQ_CST);
+                if (controller->BufferAppendCallback != 0 && __atomic_load_n(&controller->workspace.stage, __ATOMIC_SEQ_CST) == Command_PARSE_STAGE_DONE)
+                {
+                    Command_RaiseTrigger(controller); // Parser is waiting for a free slot, nothing else will wake it up.
+                }
+                return frame;
+            }
+            // pos has been reloaded by compare exchange.
+        }
+        else if (diff < 0)
+        {
+            return 0; // empty
+        }
+        else
+        {
+            pos = __atomic_load_n(&controller->frameDequeuePos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static int8_t Command_IsTriggered(Command_Controller *controller)
+{
+    uint32_t appendedLength = __atomic_load_n(&controller->appendedLength, __ATOMIC_RELAXED);
+    if (appendedLength == 0)
+    {
+        return 0;
+    }
+    if (controller->trigger.waitExpectLength && appendedLength >= __atomic_load_n(&controller->workspace.expectAvailableLength, __ATOMIC_RELAXED))
+    {
+        return 1;
+    }
+    if (controller->trigger.thresholdLength != 0 && appendedLength >= controller->trigger.thresholdLength)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+static void Command_RaiseTrigger(Command_Controller *controller)
+{
+    if (__atomic_exchange_n(&controller->parseTriggered, 1, __ATOMIC_ACQ_REL) == 0) // Only once until parsed.
+    {
+        controller->BufferAppendCallback(controller);
+    }
+}
+
+static void Command_ApplyFilters(Command_Controller *controller, uint32_t scannedLength)
+{
+    Command_Filter *filter = controller->workspace.pendingFilter;
+    while (filter != 0 && filter->offset + filter->size <= scannedLength)
+    {
+        char field[COMMAND_FILTER_FIELD_MAX_SIZE];
+        Command_CopyData(controller->workspace.startBuffer, controller->workspace.startOffset, filter->offset, filter->size, field);
+        if (filter->Predicate(controller, field, filter->size) != 0)
+        {
+            controller->workspace.rejected = 1;
+            filter = 0; // No need to evaluate the others.
+            break;
+        }
+        filter = filter->nextFilter;
+    }
+    controller->workspace.pendingFilter = filter;
+}
+
+static inline uint32_t Command_GetDistance(Command_Buffer *fromBuffer, int32_t fromOffset, Command_Buffer *toBuffer, int32_t toOffset)
+{
+    uint32_t distance = 0;
+    while (fromBuffer != toBuffer)
+    {
+        distance += fromBuffer->size;
+        fromBuffer = Command_NextBuffer(fromBuffer);
+    }
+    return distance + toOffset - fromOffset;
+}
+
+static void Command_CopyData(Command_Buffer *buffer, int32_t offset, uint32_t pos, uint32_t length, char *dist)
+{
+    uint32_t startIndex = offset + 1 + pos;
+
+    while (startIndex >= buffer->size)
+    {
+        startIndex -= buffer->size;
+        buffer = Command_NextBuffer(buffer);
+    }
+    uint32_t remainLength = length;
+    while (remainLength > 0)
+    {
+        uint32_t copySize = remainLength > (buffer->size - startIndex) ? (buffer->size - startIndex) : remainLength;
+        memcpy(dist, (buffer->data) + startIndex, copySize);
+        remainLength -= copySize;
+        dist += copySize;
+        if (remainLength > 0) // Do not touch next pointer of the last buffer, it may be appended concurrently.
+        {
+            buffer = Command_NextBuffer(buffer);
+            startIndex = 0;
+        }
+    }
+}
+
 static void Command_ComputeNext(char *p, uint8_t M, int8_t *next)
 {
     next[0] = -1;
@@ -157,6 +401,11 @@ static int8_t Command_InitWorkspace(Command_Controller *controller, Command_Conf
     controller->workspace.startOffset = -1;
     controller->workspace.currentContentLength = 0;
     controller->workspace.config = config;
+    controller->workspace.pendingFilter = controller->filters;
+    controller->workspace.rejected = 0;
+    controller->workspace.segmentStartBuffer = 0; // Segment of the previous frame is no longer a rewind target, do not pin buffers with it.
+    controller->workspace.matchedHeadBuffer = 0;
+    controller->workspace.matchedLength = -1;
     controller->workspace.stage = Command_PARSE_STAGE_INIT;
     return 0;
 }
@@ -165,8 +414,11 @@ static inline int8_t Command_ScanContent(Command_Controller *controller, uint32_
     Command_Buffer *buffer = controller->workspace.lastBuffer;
     int32_t offset = controller->workspace.lastOffset;
 
-    controller->workspace.segmentStartBuffer = buffer;
-    controller->workspace.segmentStartOffset = offset;
+    if (controller->workspace.currentContentLength == 0) // Content segment starts here, keep it while resuming.
+    {
+        controller->workspace.segmentStartBuffer = buffer;
+        controller->workspace.segmentStartOffset = offset;
+    }
 
     uint32_t remainLength = expectLength;
 
@@ -175,30 +427,31 @@ static inline int8_t Command_ScanContent(Command_Controller *controller, uint32_
     {
         remainLength -= emptySize;
 
-        if (buffer->nextBuffer == 0)
+        if (Command_NextBuffer(buffer) == 0)
         {
             controller->workspace.lastBuffer = buffer;
             controller->workspace.lastOffset = buffer->size - 1;
+            __atomic_store_n(&controller->workspace.expectAvailableLength, remainLength + controller->workspace.config.suffixFieldSize, __ATOMIC_RELAXED);
             *scanedLength = expectLength - remainLength;
             return 1;
         }
         else
         {
-            buffer = buffer->nextBuffer;
+            buffer = Command_NextBuffer(buffer);
             offset = -1;
             emptySize = buffer->size;
         }
     }
 
     controller->workspace.lastBuffer = buffer;
-    controller->workspace.lastOffset = remainLength - 1;
+    controller->workspace.lastOffset = offset + remainLength;
 
     *scanedLength = expectLength;
 
     return 0;
 }
 
-static inline int8_t Command_HasAvailableLength(Command_Buffer *lastBuffer, int32_t lastOffset, uint32_t length)
+static inline uint32_t Command_GetMissingLength(Command_Buffer *lastBuffer, int32_t lastOffset, uint32_t length)
 {
     int32_t expectLastOffset = lastOffset + length;
     do
@@ -208,18 +461,20 @@ static inline int8_t Command_HasAvailableLength(Command_Buffer *lastBuffer, int3
             return 0;
         }
         expectLastOffset -= lastBuffer->size;
-        lastBuffer = lastBuffer->nextBuffer;
+        lastBuffer = Command_NextBuffer(lastBuffer);
     } while (lastBuffer != 0);
 
-    return 1;
+    return expectLastOffset + 1;
 }
 
 static int8_t Command_ScanUint(Command_Controller *controller, uint8_t size, uint32_t *value)
 {
     Command_Buffer *buffer = controller->workspace.lastBuffer;
     int32_t offset = controller->workspace.lastOffset;
-    if (Command_HasAvailableLength(buffer, offset, size) != 0)
+    uint32_t missingLength = Command_GetMissingLength(buffer, offset, size);
+    if (missingLength != 0)
     {
+        __atomic_store_n(&controller->workspace.expectAvailableLength, missingLength, __ATOMIC_RELAXED);
         return 1;
     }
 
@@ -232,7 +487,7 @@ static int8_t Command_ScanUint(Command_Controller *controller, uint8_t size, uin
         offset++;
         if (offset == buffer->size)
         {
-            buffer = buffer->nextBuffer;
+            buffer = Command_NextBuffer(buffer);
             offset = 0;
         }
         tmpValue = (tmpValue << 8) + buffer->data[offset];
@@ -249,28 +504,45 @@ static int8_t Command_ScanChars(Command_Controller *controller, char *p, int8_t
     Command_Buffer *curBuffer = controller->workspace.lastBuffer;
     int32_t curOffset = controller->workspace.lastOffset;
 
+    Command_Buffer *matchedHeadBuffer; // point to the previous position of she current matched head
+    int32_t matchedHeadOffset;
+    int j;
+
+    if (controller->workspace.matchedLength >= 0) // resume, lastOffset point to the last examined char.
+    {
+        matchedHeadBuffer = controller->workspace.matchedHeadBuffer;
+        matchedHeadOffset = controller->workspace.matchedHeadOffset;
+        j = controller->workspace.matchedLength;
+        curOffset++;
+    }
+    else
+    {
+        matchedHeadBuffer = curBuffer;
+        matchedHeadOffset = curOffset;
+        j = -1;
+    }
+
     char *curData = curBuffer->data;
     uint32_t curSize = curBuffer->size;
-
-    Command_Buffer *matchedHeadBuffer = curBuffer; // point to the previous position of she current matched head
     uint32_t matchedHeadSize = matchedHeadBuffer->size;
-    int32_t matchedHeadOffset = curOffset;
-
-    int j = -1;
 
     do
     {
         if (curOffset == curSize) // check first for the possibility of go back to last parsed position
         {
-            if (curBuffer->nextBuffer == 0)
+            if (Command_NextBuffer(curBuffer) == 0)
             {
-                controller->workspace.lastBuffer = matchedHeadBuffer;
-                controller->workspace.lastOffset = matchedHeadOffset;
+                controller->workspace.lastBuffer = curBuffer;
+                controller->workspace.lastOffset = curOffset - 1;
+                controller->workspace.matchedHeadBuffer = matchedHeadBuffer;
+                controller->workspace.matchedHeadOffset = matchedHeadOffset;
+                controller->workspace.matchedLength = j;
+                __atomic_store_n(&controller->workspace.expectAvailableLength, pSize - j, __ATOMIC_RELAXED);
                 return 1;
             }
             else
             {
-                curBuffer = curBuffer->nextBuffer;
+                curBuffer = Command_NextBuffer(curBuffer);
                 curOffset = 0;
                 curData = curBuffer->data;
                 curSize = curBuffer->size;
@@ -289,7 +561,7 @@ static int8_t Command_ScanChars(Command_Controller *controller, char *p, int8_t
             {
                 // matchHead point to current match head, can not been overflowed;
                 matchedHeadOffset -= matchedHeadSize;
-                matchedHeadBuffer = matchedHeadBuffer->nextBuffer;
+                matchedHeadBuffer = Command_NextBuffer(matchedHeadBuffer);
                 matchedHeadSize = matchedHeadBuffer->size;
             }
             j = next[j];
@@ -299,6 +571,8 @@ static int8_t Command_ScanChars(Command_Controller *controller, char *p, int8_t
     curOffset--; // back to last parsed position
     controller->workspace.lastBuffer = curBuffer;
     controller->workspace.lastOffset = curOffset;
+    controller->workspace.matchedHeadBuffer = 0;
+    controller->workspace.matchedLength = -1;
 
     controller->workspace.segmentStartBuffer = matchedHeadBuffer;
     controller->workspace.segmentStartOffset = matchedHeadOffset;
@@ -319,8 +593,10 @@ static int8_t Command_MatchChars(Command_Controller *controller, char *pattern,
     controller->workspace.segmentStartBuffer = buffer;
     controller->workspace.segmentStartOffset = offset;
 
-    if (Command_HasAvailableLength(buffer, offset, size) != 0)
+    uint32_t missingLength = Command_GetMissingLength(buffer, offset, size);
+    if (missingLength != 0)
     {
+        __atomic_store_n(&controller->workspace.expectAvailableLength, missingLength, __ATOMIC_RELAXED);
         return 1;
     }
     for (uint8_t i = 0; i < size; i++)
@@ -328,7 +604,7 @@ static int8_t Command_MatchChars(Command_Controller *controller, char *pattern,
         offset++;
         if (offset == buffer->size)
         {
-            buffer = buffer->nextBuffer;
+            buffer = Command_NextBuffer(buffer);
             offset = 0;
         }
         if (buffer->data[offset] != pattern[i])
@@ -353,16 +629,20 @@ int8_t Command_Init(Command_Controller *controller, Command_Config cfg, char *na
     controller->config = cfg;
     controller->outerState = outerState;
     controller->BufferAppendCallback = bufferAppendCallback;
+    controller->trigger = (Command_Trigger){0};
+    controller->appendedLength = 0;
+    controller->lastAppendTick = 0;
+    controller->parseTriggered = 0;
 
     if (cfg.prefixFieldSize != 0)
     {
-        int8_t *lps = Command_Malloc(controller, cfg.prefixFieldSize);
+        int8_t *lps = Command_Malloc(controller, cfg.prefixFieldSize + 1); // next[M] is computed as well.
         Command_ComputeNext(cfg.prefixChars, cfg.prefixFieldSize, lps);
         controller->prefixNexts = lps;
     }
     if (cfg.suffixFieldSize != 0)
     {
-        int8_t *lps = Command_Malloc(controller, cfg.suffixFieldSize);
+        int8_t *lps = Command_Malloc(controller, cfg.suffixFieldSize + 1); // next[M] is computed as well.
         Command_ComputeNext(cfg.suffixChars, cfg.suffixFieldSize, lps);
         controller->suffixNexts = lps;
     }
@@ -370,10 +650,66 @@ int8_t Command_Init(Command_Controller *controller, Command_Config cfg, char *na
     Command_Buffer *initBuffer = Command_Malloc(controller, sizeof(Command_Buffer));
     initBuffer->data = Command_Malloc(controller, 1);
     initBuffer->size = 1;
+    initBuffer->nextBuffer = 0;
+    initBuffer->refCount = 0;
+    initBuffer->completed = 0;
     controller->bufferHead = initBuffer;
     controller->bufferTail = initBuffer;
+    controller->parsedBuffer = initBuffer;
+    controller->pendingFramesHead = 0;
+    controller->pendingFramesTail = 0;
+    controller->frameSlots = 0;
+    controller->reclaimRequests = 0;
+    controller->filters = 0;
+    controller->workspace.startBuffer = 0;
+    controller->workspace.segmentStartBuffer = 0;
+    controller->workspace.segmentStartOffset = 0;
+    controller->workspace.matchedHeadBuffer = 0;
+    controller->workspace.matchedLength = -1;
     controller->workspace.lastBuffer = initBuffer;
     controller->workspace.lastOffset = 0;
+    controller->workspace.expectAvailableLength = 0;
+    controller->workspace.stage = Command_PARSE_STAGE_INIT;
+
+    return 0;
+}
+
+int8_t Command_InitFrameQueue(Command_Controller *controller, uint32_t capacity)
+{
+    if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+    {
+        return COMMAND_CONFIG_ERROR_QUEUE_CAPACITY_MUST_BE_POWER_OF_2;
+    }
+
+    Command_FrameSlot *slots = Command_Malloc(controller, sizeof(Command_FrameSlot) * capacity);
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        slots[i].sequence = i;
+        slots[i].frame = 0;
+    }
+    controller->frameSlotMask = capacity - 1;
+    controller->frameEnqueuePos = 0;
+    controller->frameDequeuePos = 0;
+    controller->frameSlots = slots;
+
+    return 0;
+}
+
+int8_t Command_AddFilter(Command_Controller *controller, Command_Filter *filter)
+{
+    if (filter->size == 0 || filter->size > COMMAND_FILTER_FIELD_MAX_SIZE)
+    {
+        return COMMAND_CONFIG_ERROR_FILTER_FIELD_SIZE_OUT_OF_RANGE;
+    }
+
+    uint32_t endPos = filter->offset + filter->size;
+    Command_Filter **link = &controller->filters;
+    while (*link != 0 && (*link)->offset + (*link)->size <= endPos)
+    {
+        link = &(*link)->nextFilter;
+    }
+    filter->nextFilter = *link;
+    *link = filter;
 
     return 0;
 }
@@ -385,15 +721,63 @@ void Command_AppendBuffer(Command_Controller *controller, char *data, uint32_t s
     Command_Buffer *bufPtr = (Command_Buffer *)Command_Malloc(controller, sizeof(Command_Buffer));
     bufPtr->data = dataPtr;
     bufPtr->size = size;
+    bufPtr->nextBuffer = 0;
     bufPtr->refCount = 0;
     bufPtr->completed = 0;
 
-    controller->bufferTail->nextBuffer = bufPtr;
+    __atomic_store_n(&controller->bufferTail->nextBuffer, bufPtr, __ATOMIC_RELEASE); // Publish after data and size are set, parser may be scanning the tail.
     controller->bufferTail = bufPtr;
 
+    __atomic_add_fetch(&controller->appendedLength, size, __ATOMIC_RELAXED);
+    if (controller->trigger.idleTimeout != 0)
+    {
+        __atomic_store_n(&controller->lastAppendTick, Command_GetTick(controller), __ATOMIC_RELAXED);
+    }
+
     if (controller->BufferAppendCallback != 0)
     {
-        controller->BufferAppendCallback(controller);
+        Command_Trigger *trigger = &controller->trigger;
+        if (trigger->waitExpectLength == 0 && trigger->thresholdLength == 0 && trigger->idleTimeout == 0)
+        {
+            controller->BufferAppendCallback(controller); // No policy, trigger on every append.
+        }
+        else if (Command_IsTriggered(controller))
+        {
+            Command_RaiseTrigger(controller);
+        }
+    }
+}
+
+void Command_SetTrigger(Command_Controller *controller, Command_Trigger trigger)
+{
+    controller->trigger = trigger;
+}
+
+void Command_Poll(Command_Controller *controller)
+{
+    if (controller->BufferAppendCallback == 0)
+    {
+        return;
+    }
+    if (controller->frameSlots != 0 && __atomic_load_n(&controller->workspace.stage, __ATOMIC_SEQ_CST) == Command_PARSE_STAGE_DONE)
+    {
+        if (Command_HasFreeSlot(controller))
+        {
+            Command_RaiseTrigger(controller); // Parser is parked for a free slot, not for data.
+        }
+        return;
+    }
+    if (controller->trigger.idleTimeout == 0)
+    {
+        return;
+    }
+    if (__atomic_load_n(&controller->appendedLength, __ATOMIC_RELAXED) == 0)
+    {
+        return;
+    }
+    if (Command_GetTick(controller) - __atomic_load_n(&controller->lastAppendTick, __ATOMIC_RELAXED) >= controller->trigger.idleTimeout)
+    {
+        Command_RaiseTrigger(controller);
     }
 }
 
@@ -403,11 +787,19 @@ int8_t Command_Parse(Command_Controller *controller, Command_Config *customConfi
     uint8_t frameCount = 0;
     Command_Config config = controller->workspace.config;
 
+    __atomic_store_n(&controller->appendedLength, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&controller->parseTriggered, 0, __ATOMIC_RELEASE);
+
     if (customConfig != 0)
     {
         config = *customConfig;
-        controller->workspace.lastBuffer = controller->workspace.segmentStartBuffer;
-        controller->workspace.lastOffset = controller->workspace.segmentStartOffset;
+        if (controller->workspace.segmentStartBuffer != 0) // Cleared between frames, nothing to rewind then.
+        {
+            controller->workspace.lastBuffer = controller->workspace.segmentStartBuffer;
+            controller->workspace.lastOffset = controller->workspace.segmentStartOffset;
+        }
+        controller->workspace.matchedHeadBuffer = 0;
+        controller->workspace.matchedLength = -1;
         Command_ClearBuffer(controller);
         stage = Command_PARSE_STAGE_SEEKING_PREFIX;
     }
@@ -431,6 +823,7 @@ int8_t Command_Parse(Command_Controller *controller, Command_Config *customConfi
                 result = Command_ScanChars(controller, config.prefixChars, controller->prefixNexts, config.prefixFieldSize);
                 if (result != 0)
                 {
+                    __atomic_store_n(&controller->workspace.expectAvailableLength, controller->workspace.expectAvailableLength + config.lengthFieldSize + config.suffixFieldSize, __ATOMIC_RELAXED); // The rest of the frame can not be shorter.
                     stage = Command_PARSE_STAGE_SEEKING_PREFIX;
                     break;
                 }
@@ -450,6 +843,7 @@ int8_t Command_Parse(Command_Controller *controller, Command_Config *customConfi
                 result = Command_ScanUint(controller, config.lengthFieldSize, &expectLength);
                 if (result != 0)
                 {
+                    __atomic_store_n(&controller->workspace.expectAvailableLength, controller->workspace.expectAvailableLength + config.suffixFieldSize, __ATOMIC_RELAXED);
                     stage = Command_PARSE_STAGE_SEEKING_LENGTH;
                     break;
                 }
@@ -461,14 +855,16 @@ int8_t Command_Parse(Command_Controller *controller, Command_Config *customConfi
                         controller->workspace.startBuffer = controller->workspace.segmentStartBuffer;
                         controller->workspace.startOffset = controller->workspace.segmentStartOffset;
                     }
+                    Command_ApplyFilters(controller, (config.lengthIncludePrefix != 0 ? config.prefixFieldSize : 0) + config.lengthFieldSize);
                 }
             }
         case Command_PARSE_STAGE_SEEKING_CONTENT:
             if (config.lengthFieldSize != 0)
             {
                 uint32_t parsedLength = 0;
-                result = Command_ScanContent(controller, controller->workspace.expectContentLength, &parsedLength);
+                result = Command_ScanContent(controller, controller->workspace.expectContentLength - controller->workspace.currentContentLength, &parsedLength);
                 controller->workspace.currentContentLength += parsedLength;
+                Command_ApplyFilters(controller, (config.lengthIncludePrefix != 0 ? config.prefixFieldSize : 0) + config.lengthFieldSize + controller->workspace.currentContentLength);
                 if (result != 0)
                 {
                     stage = Command_PARSE_STAGE_SEEKING_CONTENT;
@@ -526,6 +922,15 @@ int8_t Command_Parse(Command_Controller *controller, Command_Config *customConfi
             }
 
         case Command_PARSE_STAGE_DONE:
+            if (controller->workspace.pendingFilter != 0)
+            {
+                Command_ApplyFilters(controller, Command_GetDistance(controller->workspace.startBuffer, controller->workspace.startOffset, controller->workspace.lastBuffer, controller->workspace.lastOffset));
+            }
+            if (controller->workspace.rejected != 0)
+            {
+                stage = Command_PARSE_STAGE_INIT; // Skip the frame, its buffers will be reclaimed as parser moves forward.
+                break;
+            }
             result = Command_PackFrame(controller);
             if (result == 0)
             {
@@ -534,6 +939,12 @@ int8_t Command_Parse(Command_Controller *controller, Command_Config *customConfi
                 frameCount++;
                 break;
             }
+            else if (result == 1) // frame queue is full, retry at next parse.
+            {
+                __atomic_store_n(&controller->workspace.expectAvailableLength, 0, __ATOMIC_RELAXED);
+                stage = Command_PARSE_STAGE_DONE;
+                break;
+            }
 
         case Command_PARSE_STAGE_ABORT:
 
@@ -548,7 +959,7 @@ int8_t Command_Parse(Command_Controller *controller, Command_Config *customConfi
         if (result == 1)
         {
             // not enough data, exit and wait for next buffer.
-            controller->workspace.stage = stage;
+            __atomic_store_n(&controller->workspace.stage, stage, __ATOMIC_SEQ_CST); // Seen by consumers, see Command_DequeueFrame.
             break;
         }
         else // everything is ok.
@@ -556,11 +967,28 @@ int8_t Command_Parse(Command_Controller *controller, Command_Config *customConfi
         }
     }
 
+    Command_AdvanceParsedBuffer(controller);
+    Command_ReclaimBuffers(controller);
+
+    if (controller->BufferAppendCallback != 0 && Command_IsTriggered(controller))
+    {
+        Command_RaiseTrigger(controller); // Data appended while parsing may already be enough for the new expectation.
+    }
+    else if (controller->BufferAppendCallback != 0 && controller->workspace.stage == Command_PARSE_STAGE_DONE && Command_HasFreeSlot(controller))
+    {
+        Command_RaiseTrigger(controller); // Slot freed by consumer before the done stage was published.
+    }
+
     return frameCount;
 }
 
 Command_Frame *Command_PickFrame(Command_Controller *controller)
 {
+    if (controller->frameSlots != 0)
+    {
+        return Command_DequeueFrame(controller);
+    }
+
     Command_Frame *frame = controller->pendingFramesHead;
     if (frame == 0)
     {
@@ -576,107 +1004,53 @@ Command_Frame *Command_PickFrame(Command_Controller *controller)
 
 void Command_ReleaseFrame(Command_Controller *controller, Command_Frame *frame)
 {
-    Command_Buffer *buffer = frame->startBuffer;
+    __atomic_sub_fetch(&frame->startBuffer->refCount, 1, __ATOMIC_RELEASE); // Release reference count.
+    Command_Mrelease(controller, frame);
 
-    while (buffer != 0)
-    {
-        (buffer->refCount)--; // Add reference count.
+    Command_ReclaimBuffers(controller);
+}
 
-        if (buffer == frame->lastBuffer)
+int8_t Command_ClearFrame(Command_Controller *controller)
+{
+    if (controller->frameSlots != 0)
+    {
+        Command_Frame *frame;
+        while ((frame = Command_DequeueFrame(controller)) != 0)
         {
-            break;
+            __atomic_sub_fetch(&frame->startBuffer->refCount, 1, __ATOMIC_RELEASE); // Release reference count.
+            Command_Mrelease(controller, frame);
         }
-    }
 
-    Command_Mrelease(controller, frame);
+        Command_ReclaimBuffers(controller);
 
-    buffer = controller->bufferHead;
-    while (buffer != 0)
-    {
-        Command_Buffer *nextBuffer = buffer->nextBuffer;
-        if (buffer->refCount == 0 && buffer->completed)
-        {
-            Command_Mrelease(controller, buffer->data);
-            Command_Mrelease(controller, buffer);
-        }
-        else
-        {
-            controller->bufferHead = buffer;
-            break;
-        }
-        buffer = nextBuffer;
+        return 0;
     }
-}
 
-int8_t Command_ClearFrame(Command_Controller *controller)
-{
     Command_Frame *frame = controller->pendingFramesHead;
-    Command_Buffer *buffer = 0;
     while (frame != 0)
     {
-        buffer = frame->startBuffer;
-
-        while (buffer != 0)
-        {
-            (buffer->refCount)--; // Add reference count.
+        __atomic_sub_fetch(&frame->startBuffer->refCount, 1, __ATOMIC_RELEASE); // Release reference count.
 
-            if (buffer == frame->lastBuffer)
-            {
-                break;
-            }
-        }
         Command_Frame *nextFrame = frame->nextFrame;
         Command_Mrelease(controller, frame);
         frame = nextFrame;
     }
+    controller->pendingFramesHead = 0;
+    controller->pendingFramesTail = 0;
 
-    buffer = controller->bufferHead;
-    while (buffer != 0)
-    {
-        Command_Buffer *nextBuffer = buffer->nextBuffer;
-        if (buffer->refCount == 0 && buffer->completed)
-        {
-            Command_Mrelease(controller, buffer->data);
-            Command_Mrelease(controller, buffer);
-        }
-        else
-        {
-            controller->bufferHead = buffer;
-            break;
-        }
-        buffer = nextBuffer;
-    }
+    Command_ReclaimBuffers(controller);
 
     return 0;
 }
 
 uint32_t Command_ExtractFrame(Command_Frame *frame, uint32_t startPos, uint32_t length, char *dist)
 {
-    Command_Buffer *buffer = frame->startBuffer;
     if (length == 0 || (startPos + length) > frame->length)
     {
         length = frame->length - startPos; // Length==0 means copy to the end of the frame; If length out of set end of the frame, just copy available length;
     }
 
-    uint32_t startIndex = frame->startOffset + 1;
-
-    startIndex += startPos;
-
-    while (startIndex >= buffer->size)
-    {
-        buffer = buffer->nextBuffer;
-        startIndex -= buffer->size;
-    }
-    uint32_t remainLength = length;
-    while (remainLength > 0)
-    {
-        uint32_t copySize = remainLength > (buffer->size - startIndex) ? (buffer->size - startIndex) : remainLength;
-        memcpy(dist, (buffer->data) + startIndex, copySize);
-        remainLength -= copySize;
-        dist += copySize;
-        buffer = buffer->nextBuffer;
-        startIndex = 0;
-    }
+    Command_CopyData(frame->startBuffer, frame->startOffset, startPos, length, dist);
 
     return length;
-}
\ No newline at end of file
+}
@@ -11,4 +11,9 @@ void *Command_Malloc(Command_Controller *controller, uint32_t size)
 void Command_Mrelease(Command_Controller *controller, void *ptr)
 {
     tx_byte_release(ptr);
-}
\ No newline at end of file
+}
+
+uint32_t Command_GetTick(Command_Controller *controller)
+{
+    return tx_time_get();
+}
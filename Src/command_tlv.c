@@ -0,0 +1,252 @@
+#include "stdint.h"
+#include "command/command.h"
+#include "string.h"
+
+#define COMMAND_TLV_INIT_CAPACITY 8U
+
+typedef struct Command_TlvCursor
+{
+    Command_Buffer *buffer;
+    uint32_t index; // May point beyond the buffer, normalized before read.
+} Command_TlvCursor;
+
+static void Command_TlvBuild(Command_TlvIndex *index);
+
+static void Command_TlvBuildSlots(Command_TlvIndex *index);
+
+static uint32_t Command_TlvHash(uint32_t tag);
+
+static uint8_t Command_TlvReadByte(Command_TlvCursor *cursor);
+
+/**
+ * @arg
+ * @arg size: 1-4 bytes.
+ * */
+static uint32_t Command_TlvReadUint(Command_TlvCursor *cursor, uint8_t size, uint8_t littleEndian);
+
+static inline uint32_t Command_TlvHash(uint32_t tag)
+{
+    tag ^= tag >> 16;
+    tag *= 0x45d9f3bU;
+    tag ^= tag >> 16;
+    return tag;
+}
+
+static inline uint8_t Command_TlvReadByte(Command_TlvCursor *cursor)
+{
+    while (cursor->index >= cursor->buffer->size)
+    {
+        cursor->index -= cursor->buffer->size;
+        cursor->buffer = cursor->buffer->nextBuffer;
+    }
+    return (uint8_t)cursor->buffer->data[cursor->index++];
+}
+
+static uint32_t Command_TlvReadUint(Command_TlvCursor *cursor, uint8_t size, uint8_t littleEndian)
+{
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < size; i++)
+    {
+        uint32_t byte = Command_TlvReadByte(cursor);
+        if (littleEndian)
+        {
+            value |= byte << (8 * i);
+        }
+        else
+        {
+            value = (value << 8) | byte;
+        }
+    }
+    return value;
+}
+
+static void Command_TlvBuildSlots(Command_TlvIndex *index)
+{
+    uint32_t slotCount = 2;
+    while (slotCount < index->entryCount * 2) // Keep load factor under 0.5.
+    {
+        slotCount <<= 1;
+    }
+
+    uint32_t *slots = Command_Malloc(index->controller, sizeof(uint32_t) * slotCount);
+    memset(slots, 0, sizeof(uint32_t) * slotCount);
+    uint32_t mask = slotCount - 1;
+
+    for (uint32_t i = 0; i < index->entryCount; i++)
+    {
+        uint32_t tag = index->entries[i].tag;
+        uint32_t slot = Command_TlvHash(tag) & mask;
+        while (slots[slot] != 0 && index->entries[slots[slot] - 1].tag != tag)
+        {
+            slot = (slot + 1) & mask;
+        }
+        if (slots[slot] == 0) // Keep the first entry for duplicated tags.
+        {
+            slots[slot] = i + 1;
+        }
+    }
+
+    index->slots = slots;
+    index->slotMask = mask;
+}
+
+static void Command_TlvBuild(Command_TlvIndex *index)
+{
+    Command_Frame *frame = index->frame;
+    Command_TlvConfig config = index->config;
+    uint32_t headerSize = config.tagFieldSize + config.lengthFieldSize;
+
+    Command_TlvCursor cursor;
+    cursor.buffer = frame->startBuffer;
+    cursor.index = frame->startOffset + 1 + index->startPos;
+
+    uint32_t capacity = 0;
+    uint32_t pos = 0;
+    while (pos + headerSize <= index->length)
+    {
+        uint32_t tag = Command_TlvReadUint(&cursor, config.tagFieldSize, config.littleEndian);
+        uint32_t valueLength = Command_TlvReadUint(&cursor, config.lengthFieldSize, config.littleEndian);
+        pos += headerSize;
+        if (valueLength > index->length - pos)
+        {
+            break;
+        }
+
+        if (index->entryCount == capacity)
+        {
+            capacity = capacity == 0 ? COMMAND_TLV_INIT_CAPACITY : capacity * 2;
+            Command_TlvEntry *entries = Command_Malloc(index->controller, sizeof(Command_TlvEntry) * capacity);
+            if (index->entries != 0)
+            {
+                memcpy(entries, index->entries, sizeof(Command_TlvEntry) * index->entryCount);
+                Command_Mrelease(index->controller, index->entries);
+            }
+            index->entries = entries;
+        }
+
+        Command_TlvEntry *entry = &index->entries[index->entryCount++];
+        entry->tag = tag;
+        entry->valuePos = index->startPos + pos;
+        entry->valueLength = valueLength;
+
+        cursor.index += valueLength; // Skip value without reading.
+        pos += valueLength;
+    }
+
+    index->malformed |= pos != index->length; // May have been set by clamping in Command_TlvInit.
+    index->built = 1;
+
+    if (index->entryCount != 0)
+    {
+        Command_TlvBuildSlots(index);
+    }
+}
+
+int8_t Command_TlvInit(Command_Controller *controller, Command_TlvIndex *index, Command_Frame *frame, uint32_t startPos, uint32_t length, Command_TlvConfig config)
+{
+    if (config.tagFieldSize == 0 || config.tagFieldSize > 4 || config.lengthFieldSize == 0 || config.lengthFieldSize > 4)
+    {
+        return COMMAND_CONFIG_ERROR_TLV_FIELD_SIZE_OUT_OF_RANGE;
+    }
+
+    index->malformed = 0;
+    if (startPos > frame->length)
+    {
+        startPos = frame->length;
+        index->malformed = 1;
+    }
+    if (length > frame->length - startPos) // Never read beyond the frame, the buffers after it may be appended concurrently.
+    {
+        length = frame->length - startPos;
+        index->malformed = 1;
+    }
+
+    index->controller = controller;
+    index->frame = frame;
+    index->config = config;
+    index->startPos = startPos;
+    index->length = length;
+    index->entries = 0;
+    index->entryCount = 0;
+    index->slots = 0;
+    index->slotMask = 0;
+    index->built = 0;
+
+    return 0;
+}
+
+int8_t Command_TlvInitNested(Command_TlvIndex *index, Command_TlvIndex *parent, Command_TlvEntry *entry)
+{
+    return Command_TlvInit(parent->controller, index, parent->frame, entry->valuePos, entry->valueLength, parent->config);
+}
+
+uint32_t Command_TlvGetCount(Command_TlvIndex *index)
+{
+    if (!index->built)
+    {
+        Command_TlvBuild(index);
+    }
+    return index->entryCount;
+}
+
+Command_TlvEntry *Command_TlvGetEntry(Command_TlvIndex *index, uint32_t i)
+{
+    if (!index->built)
+    {
+        Command_TlvBuild(index);
+    }
+    if (i >= index->entryCount)
+    {
+        return 0;
+    }
+    return &index->entries[i];
+}
+
+Command_TlvEntry *Command_TlvFind(Command_TlvIndex *index, uint32_t tag)
+{
+    if (!index->built)
+    {
+        Command_TlvBuild(index);
+    }
+    if (index->slots == 0)
+    {
+        return 0;
+    }
+
+    uint32_t slot = Command_TlvHash(tag) & index->slotMask;
+    while (index->slots[slot] != 0)
+    {
+        Command_TlvEntry *entry = &index->entries[index->slots[slot] - 1];
+        if (entry->tag == tag)
+        {
+            return entry;
+        }
+        slot = (slot + 1) & index->slotMask;
+    }
+    return 0;
+}
+
+uint32_t Command_TlvExtractValue(Command_TlvIndex *index, Command_TlvEntry *entry, char *dist)
+{
+    if (entry->valueLength == 0)
+    {
+        return 0;
+    }
+    return Command_ExtractFrame(index->frame, entry->valuePos, entry->valueLength, dist);
+}
+
+void Command_TlvRelease(Command_TlvIndex *index)
+{
+    if (index->entries != 0)
+    {
+        Command_Mrelease(index->controller, index->entries);
+        index->entries = 0;
+    }
+    if (index->slots != 0)
+    {
+        Command_Mrelease(index->controller, index->slots);
+        index->slots = 0;
+    }
+    index->entryCount = 0;
+    index->built = 0;
+}